@@ -0,0 +1,337 @@
+#ifndef FRAMESINK_H
+#define FRAMESINK_H
+#pragma once
+#include<vector>
+#include<string>
+#include<memory>
+#include<algorithm>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<chrono>
+#include<iostream>
+#include<cerrno>
+#include<climits>
+#include<cstring>
+#include<cstdio>
+#ifdef __linux__
+#include<fcntl.h>
+#include<unistd.h>
+#include<signal.h>
+#include<pthread.h>
+#include<sys/uio.h>
+#endif
+#ifdef _WIN32
+#include<io.h>
+#include<fcntl.h>
+#endif
+#include"rasterization.h"
+
+namespace pipeline3D {
+
+    //Encoding of the frames written by a FrameSink
+    enum class FrameFormat {
+        Raw,    //Pixels as they are in memory, frame after frame
+        PPM,    //One binary PPM image per frame: P5 (grey) for 1 byte pixels, P6 (rgb) for 3 byte pixels
+        ASCII   //Character frames with a border, one text line per row (1 byte pixels, e.g. Rasterizer<char>)
+    };
+
+    //Writes completed frames to a file, a FIFO or stdout from a background thread.
+    //submit() copies the frame once into a recycled buffer and returns; the writer thread then sends every frame queued so far
+    //straight from those buffers (vectored writes on Linux, a large stdio buffer elsewhere), so rendering never waits for the
+    //output unless all buffers are in flight. While a FIFO has no reader yet frames are dropped instead of waited for
+    template<class Target_t>
+    class FrameSink {
+    public:
+
+        //Opens path for writing ("-" is stdout). Opening happens on the writer thread, so a FIFO without readers does not block the caller
+        FrameSink(const std::string& path, FrameFormat format, unsigned int buffered_frames = 4) :
+            path_(path), format_(checked_format(format)), frames_(std::max(buffered_frames,1u)) {
+            start();
+        }
+#ifdef __linux__
+        //Writes to an already open descriptor, which is not closed by the sink
+        FrameSink(int fd, FrameFormat format, unsigned int buffered_frames = 4) :
+            fd_(fd), format_(checked_format(format)), frames_(std::max(buffered_frames,1u)) {
+            start();
+        }
+#endif
+        FrameSink(const FrameSink&) = delete;
+        FrameSink& operator=(const FrameSink&) = delete;
+
+        //Writes the frames still queued, then stops the writer. A FIFO that never got a reader is given up
+        ~FrameSink() {
+            {
+                std::lock_guard<std::mutex> lock(sink_mutex);
+                stopping = true;
+                ready_cv.notify_one();
+            }
+            writer.join();
+            close_output();
+        }
+
+        //Queues a copy of the frame; waits only when every buffer is still waiting to be written to an open output.
+        //Returns false if the frame was dropped: the sink failed, or the FIFO has no reader and all the buffers are taken
+        bool submit(const Target_t* frame, int width, int height) {
+            Frame* f;
+            {
+                std::unique_lock<std::mutex> lock(sink_mutex);
+                free_cv.wait(lock, [this]{return failed || waiting_for_reader || !free_frames.empty();});
+                if (failed || free_frames.empty()) return false;
+                f = free_frames.back();
+                free_frames.pop_back();
+            }
+            f->width = width;
+            f->height = height;
+            f->pixels.assign(frame, frame + width*height);
+            std::lock_guard<std::mutex> lock(sink_mutex);
+            ready_frames.push_back(f);
+            ready_cv.notify_one();
+            return true;
+        }
+        bool submit(const Rasterizer<Target_t>& rasterizer) {
+            return submit(rasterizer.get_target(), rasterizer.get_width(), rasterizer.get_height());
+        }
+
+        //Waits until every submitted frame has been written. Returns false without waiting if the frames cannot be written
+        //(yet): the sink failed or the FIFO has no reader
+        bool flush() {
+            std::unique_lock<std::mutex> lock(sink_mutex);
+            free_cv.wait(lock, [this]{return failed || waiting_for_reader || free_frames.size() == frames_.size();});
+            return free_frames.size() == frames_.size() && !failed;
+        }
+
+        //False once the output could not be opened, a write failed or the reader of a pipe went away: later frames are dropped
+        bool good() {
+            std::lock_guard<std::mutex> lock(sink_mutex);
+            return !failed;
+        }
+
+    private:
+
+        struct Frame {
+            int width;
+            int height;
+            std::vector<Target_t> pixels;
+            //Bytes written around the pixels (PPM header, ASCII borders), built on the writer thread
+            std::string header;
+            std::string footer;
+        };
+
+        //Piece of output referencing memory owned by a Frame (or a literal)
+        struct Chunk {
+            const char* data;
+            size_t length;
+        };
+
+        static FrameFormat checked_format(FrameFormat format) {
+            if ((format == FrameFormat::PPM && sizeof(Target_t) != 1 && sizeof(Target_t) != 3) ||
+                (format == FrameFormat::ASCII && sizeof(Target_t) != 1)) {
+                std::cerr << "WARNING! Frame format not supported for this pixel size, writing raw frames\n";
+                return FrameFormat::Raw;
+            }
+            return format;
+        }
+
+        void start() {
+            for (auto& f : frames_) {
+                f = std::make_unique<Frame>();
+                free_frames.push_back(f.get());
+            }
+            writer = std::thread(&FrameSink::write_loop, this);
+        }
+
+        //Writer thread: takes all the queued frames at once and writes them in one go
+        void write_loop() {
+#ifdef __linux__
+            //A reader leaving a pipe must not kill the renderer: with SIGPIPE blocked on this thread the write fails with EPIPE instead
+            sigset_t pipe_set;
+            sigemptyset(&pipe_set);
+            sigaddset(&pipe_set, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &pipe_set, nullptr);
+#endif
+            if (!open_output())
+                fail();
+            std::vector<Frame*> batch;
+            std::vector<Chunk> chunks;
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(sink_mutex);
+                    ready_cv.wait(lock, [this]{return stopping || !ready_frames.empty();});
+                    if (ready_frames.empty()) return;
+                    batch.swap(ready_frames);
+                }
+                chunks.clear();
+                for (Frame* f : batch)
+                    append_frame(*f, chunks);
+                const bool written = !good() || write_all(chunks);
+                std::lock_guard<std::mutex> lock(sink_mutex);
+                if (!written && !failed) {
+                    std::cerr << "ERROR! Frame sink write failed: " << std::strerror(errno) << "\n";
+                    failed = true;
+                }
+                free_frames.insert(free_frames.end(), batch.begin(), batch.end());
+                batch.clear();
+                free_cv.notify_all();
+            }
+        }
+
+        void fail() {
+            std::lock_guard<std::mutex> lock(sink_mutex);
+            failed = true;
+            free_cv.notify_all();
+        }
+
+        //Describes the frame as a list of chunks: the pixels are referenced in place, never copied again
+        void append_frame(Frame& f, std::vector<Chunk>& chunks) {
+            const char* pixels = reinterpret_cast<const char*>(f.pixels.data());
+            switch (format_) {
+            case FrameFormat::Raw:
+                chunks.push_back(Chunk{pixels, f.pixels.size()*sizeof(Target_t)});
+                break;
+            case FrameFormat::PPM:
+                f.header = (sizeof(Target_t) == 3 ? "P6\n" : "P5\n") + std::to_string(f.width) + " " + std::to_string(f.height) + "\n255\n";
+                chunks.push_back(Chunk{f.header.data(), f.header.size()});
+                chunks.push_back(Chunk{pixels, f.pixels.size()*sizeof(Target_t)});
+                break;
+            case FrameFormat::ASCII:
+                f.header = '+' + std::string(f.width, '-') + "+\n";
+                f.footer = "|\n";
+                chunks.push_back(Chunk{f.header.data(), f.header.size()});
+                for (int i = 0; i != f.height; ++i) {
+                    chunks.push_back(Chunk{f.footer.data(), 1});
+                    chunks.push_back(Chunk{pixels + i*f.width, static_cast<size_t>(f.width)});
+                    chunks.push_back(Chunk{f.footer.data(), f.footer.size()});
+                }
+                chunks.push_back(Chunk{f.header.data(), f.header.size()});
+                break;
+            }
+        }
+
+#ifdef __linux__
+        //Opens the output without blocking: a FIFO without a reader fails with ENXIO and is retried until a reader shows up
+        //or the sink is destroyed, meanwhile submit() and flush() do not wait for the writer. Writes are then blocking again
+        bool open_output() {
+            if (fd_ >= 0)
+                return true;
+            if (path_ == "-") {
+                fd_ = STDOUT_FILENO;
+                return true;
+            }
+            for (;;) {
+                fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+                if (fd_ >= 0) {
+                    owns_fd = true;
+                    ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_NONBLOCK);
+                    std::lock_guard<std::mutex> lock(sink_mutex);
+                    waiting_for_reader = false;
+                    return true;
+                }
+                if (errno != ENXIO) {
+                    std::cerr << "ERROR! Cannot open " << path_ << ": " << std::strerror(errno) << "\n";
+                    return false;
+                }
+                std::unique_lock<std::mutex> lock(sink_mutex);
+                if (!waiting_for_reader) {
+                    waiting_for_reader = true;
+                    free_cv.notify_all();
+                }
+                if (ready_cv.wait_for(lock, std::chrono::milliseconds(50), [this]{return stopping;}))
+                    return false;
+            }
+        }
+
+        void close_output() {
+            if (owns_fd && fd_ >= 0)
+                ::close(fd_);
+        }
+
+        //writev in chunks of at most IOV_MAX buffers, resuming after partial writes; EPIPE (reader gone) is a failure like any other
+        bool write_all(const std::vector<Chunk>& chunks) {
+            if (fd_ < 0) return false;
+            std::vector<iovec> iov(chunks.size());
+            for (size_t i = 0; i != chunks.size(); ++i) {
+                iov[i].iov_base = const_cast<char*>(chunks[i].data);
+                iov[i].iov_len = chunks[i].length;
+            }
+            size_t i = 0;
+            while (i < iov.size()) {
+                const int count = static_cast<int>(std::min<size_t>(iov.size()-i, IOV_MAX));
+                ssize_t n = ::writev(fd_, &iov[i], count);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                while (i < iov.size() && (n > 0 || iov[i].iov_len == 0)) {
+                    if (static_cast<size_t>(n) >= iov[i].iov_len) {
+                        n -= iov[i].iov_len;
+                        ++i;
+                    } else {
+                        iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + n;
+                        iov[i].iov_len -= n;
+                        n = 0;
+                    }
+                }
+            }
+            return true;
+        }
+
+        int fd_ {-1};
+        bool owns_fd {false};
+#else
+        //Portable fallback: stdio with a large buffer, flushed once per batch of frames
+        bool open_output() {
+            if (path_ == "-") {
+#ifdef _WIN32
+                _setmode(_fileno(stdout), _O_BINARY);
+#endif
+                file_ = stdout;
+            } else {
+                file_ = std::fopen(path_.c_str(), "wb");
+                if (!file_) {
+                    std::cerr << "ERROR! Cannot open " << path_ << ": " << std::strerror(errno) << "\n";
+                    return false;
+                }
+                owns_file = true;
+            }
+            std::setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+            return true;
+        }
+
+        void close_output() {
+            if (owns_file && file_)
+                std::fclose(file_);
+            else if (file_)
+                std::fflush(file_);
+        }
+
+        bool write_all(const std::vector<Chunk>& chunks) {
+            if (!file_) return false;
+            for (const Chunk& c : chunks)
+                if (std::fwrite(c.data, 1, c.length, file_) != c.length)
+                    return false;
+            return std::fflush(file_) == 0;
+        }
+
+        std::FILE* file_ {nullptr};
+        bool owns_file {false};
+#endif
+
+        std::string path_;
+        const FrameFormat format_;
+        //Buffer pool: a frame is either free, queued for the writer or being written
+        std::vector<std::unique_ptr<Frame>> frames_;
+        std::vector<Frame*> free_frames;
+        std::vector<Frame*> ready_frames;
+        bool stopping {false};
+        bool failed {false};
+        //Set while a FIFO is waiting for its reader: queued frames stay queued, further ones are dropped
+        bool waiting_for_reader {false};
+        std::mutex sink_mutex;
+        std::condition_variable ready_cv;
+        std::condition_variable free_cv;
+        std::thread writer;
+    };
+
+};
+#endif // FRAMESINK_H
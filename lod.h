@@ -0,0 +1,184 @@
+#ifndef LOD_H
+#define LOD_H
+#pragma once
+#include<vector>
+#include<array>
+#include<cmath>
+#include<cstdint>
+#include<limits>
+#include<algorithm>
+#include<unordered_map>
+#include<set>
+#include"rasterization.h"
+
+namespace pipeline3D {
+
+    //Mesh with precomputed levels of detail. Level 0 is the original mesh; every further level is built from level 0 by vertex
+    //clustering on a coarser grid. errors[l] is the largest distance (object units) a vertex of level 0 moved to build level l.
+    //Iterating a LodMesh visits level 0, so it can still be used as a plain mesh
+    template<class Vertex>
+    struct LodMesh {
+        std::vector<std::vector<std::array<Vertex,3>>> levels;
+        std::vector<float> errors;
+        //Bounding sphere in object space
+        std::array<float,3> center;
+        float radius;
+        //Largest on-screen displacement (pixels) accepted when picking a level
+        float max_pixel_error {1.0f};
+
+        auto begin() const {return levels[0].begin();}
+        auto end() const {return levels[0].end();}
+        size_t size() const {return levels[0].size();}
+    };
+
+    //Clusters the vertices of mesh on a grid of the given cell size: every vertex moves to the mean position of its cell and keeps its
+    //other attributes. Triangles with two vertices in the same cell collapse and are dropped, as are duplicates of the same cell triple.
+    //displacement receives the largest distance a vertex moved (up to sqrt(3)*cell)
+    template<class Vertex>
+    std::vector<std::array<Vertex,3>> cluster_vertices(const std::vector<std::array<Vertex,3>>& mesh, const std::array<float,3>& origin, float cell,
+                                                       float& displacement) {
+        //21 bits per axis: enough for grids up to 2M cells per side
+        auto key = [&origin, cell](const Vertex& v) {
+            const std::uint64_t ix = static_cast<std::uint64_t>((v.x-origin[0])/cell) & 0x1fffff;
+            const std::uint64_t iy = static_cast<std::uint64_t>((v.y-origin[1])/cell) & 0x1fffff;
+            const std::uint64_t iz = static_cast<std::uint64_t>((v.z-origin[2])/cell) & 0x1fffff;
+            return (ix<<42) | (iy<<21) | iz;
+        };
+
+        struct Cluster { float x{0}, y{0}, z{0}; unsigned int n{0}; };
+        std::unordered_map<std::uint64_t,Cluster> clusters;
+        for (const auto& t : mesh)
+            for (const auto& v : t) {
+                Cluster& c = clusters[key(v)];
+                c.x += v.x;
+                c.y += v.y;
+                c.z += v.z;
+                c.n++;
+            }
+
+        float max_squared = 0.0f;
+        for (const auto& t : mesh)
+            for (const auto& v : t) {
+                const Cluster& c = clusters[key(v)];
+                const float dx = c.x/c.n-v.x, dy = c.y/c.n-v.y, dz = c.z/c.n-v.z;
+                max_squared = std::max(max_squared, dx*dx + dy*dy + dz*dz);
+            }
+        displacement = std::sqrt(max_squared);
+
+        std::vector<std::array<Vertex,3>> result;
+        std::set<std::array<std::uint64_t,3>> kept;
+        for (const auto& t : mesh) {
+            std::array<std::uint64_t,3> k{key(t[0]), key(t[1]), key(t[2])};
+            if (k[0]==k[1] || k[1]==k[2] || k[0]==k[2])
+                continue;
+            //Same cells with the same winding describe the same simplified triangle
+            std::rotate(k.begin(), std::min_element(k.begin(), k.end()), k.end());
+            if (!kept.insert(k).second)
+                continue;
+            std::array<Vertex,3> s = t;
+            for (auto& v : s) {
+                const Cluster& c = clusters[key(v)];
+                v.x = c.x/c.n;
+                v.y = c.y/c.n;
+                v.z = c.z/c.n;
+            }
+            result.push_back(s);
+        }
+        return result;
+    }
+
+    //Builds the levels of detail of a mesh (e.g. the output of read_obj), at load time or offline.
+    //Grids get twice as coarse at each step; a level is stored only when it has at most 3/4 of the triangles of the previous stored one,
+    //and simplification goes on until the next level would drop below min_triangles (or max_levels levels are stored)
+    template<class Vertex>
+    LodMesh<Vertex> make_lod(std::vector<std::array<Vertex,3>>&& mesh, unsigned int max_levels = 8, size_t min_triangles = 32) {
+        LodMesh<Vertex> lod;
+        std::array<float,3> lo{std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+        std::array<float,3> hi{std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+        for (const auto& t : mesh)
+            for (const auto& v : t) {
+                lo = {std::min(lo[0],v.x), std::min(lo[1],v.y), std::min(lo[2],v.z)};
+                hi = {std::max(hi[0],v.x), std::max(hi[1],v.y), std::max(hi[2],v.z)};
+            }
+        if (mesh.empty()) {
+            lo = hi = {0.0f, 0.0f, 0.0f};
+        }
+        lod.center = {(lo[0]+hi[0])*0.5f, (lo[1]+hi[1])*0.5f, (lo[2]+hi[2])*0.5f};
+        const float diagonal = std::sqrt((hi[0]-lo[0])*(hi[0]-lo[0]) + (hi[1]-lo[1])*(hi[1]-lo[1]) + (hi[2]-lo[2])*(hi[2]-lo[2]));
+        lod.radius = diagonal*0.5f;
+
+        lod.levels.push_back(std::move(mesh));
+        lod.errors.push_back(0.0f);
+        //First grid: about 128 cells along the diagonal. Every level is clustered from level 0, so errors do not add up across levels
+        float cell = diagonal/128.0f;
+        while (lod.levels.size() < max_levels && cell > 0.0f && cell < 2.0f*diagonal) {
+            float displacement;
+            std::vector<std::array<Vertex,3>> level = cluster_vertices(lod.levels[0], lo, cell, displacement);
+            if (level.size() < min_triangles)
+                break;
+            if (4*level.size() <= 3*lod.levels.back().size()) {
+                lod.levels.push_back(std::move(level));
+                lod.errors.push_back(displacement);
+            }
+            cell *= 2.0f;
+        }
+        return lod;
+    }
+
+    //Number of pixels covered by one object-space unit on the sphere of centre p and given radius, at its point nearest to the eye,
+    //once transformed by world, view and the rasterizer projection. Uses the largest scale factor of the linear part of view*world,
+    //so it is conservative for non-uniform scaling. Infinity if the sphere reaches the eye plane, 0 if it lies entirely behind it
+    template<class Target_t>
+    float pixels_per_unit(const std::array<float,3>& p, float radius, const std::array<float,16>& world, const std::array<float,16>& view,
+                          const Rasterizer<Target_t>& rasterizer) {
+        std::array<float,16> M;
+        for (int i=0; i!=4; ++i)
+            for (int j=0; j!=4; ++j)
+                M[4*i+j] = view[4*i+0]*world[4*0+j] + view[4*i+1]*world[4*1+j] + view[4*i+2]*world[4*2+j] + view[4*i+3]*world[4*3+j];
+
+        const float w = p[0]*M[4*3+0] + p[1]*M[4*3+1] + p[2]*M[4*3+2] + M[4*3+3];
+        const float x = (p[0]*M[4*0+0] + p[1]*M[4*0+1] + p[2]*M[4*0+2] + M[4*0+3])/w;
+        const float y = (p[0]*M[4*1+0] + p[1]*M[4*1+1] + p[2]*M[4*1+2] + M[4*1+3])/w;
+        const float z = (p[0]*M[4*2+0] + p[1]*M[4*2+1] + p[2]*M[4*2+2] + M[4*2+3])/w;
+        float scale = 0.0f;
+        for (int j=0; j!=3; ++j)
+            scale = std::max(scale, std::sqrt(M[4*0+j]*M[4*0+j] + M[4*1+j]*M[4*1+j] + M[4*2+j]*M[4*2+j]));
+        scale /= std::abs(w);
+
+        const std::array<float,16>& P = rasterizer.projection_matrix;
+        const float clip_w = x*P[4*3+0] + y*P[4*3+1] + z*P[4*3+2] + P[4*3+3];
+        //Range of clip w over the sphere: its radius in eye space times the length of the w row of the projection
+        const float spread = radius*scale*std::sqrt(P[4*3+0]*P[4*3+0] + P[4*3+1]*P[4*3+1] + P[4*3+2]*P[4*3+2]);
+        if (clip_w + spread <= 1.0e-6f)
+            return 0.0f;
+        //Part of the sphere on or behind the eye plane (even with the centre in front): no meaningful size, ask for full detail
+        const float near_w = clip_w - spread;
+        if (near_w <= 1.0e-6f)
+            return std::numeric_limits<float>::infinity();
+        const float px = std::abs(P[4*0+0])*(rasterizer.get_width()-1)*0.5f;
+        const float py = std::abs(P[4*1+1])*(rasterizer.get_height()-1)*0.5f;
+        return scale*std::max(px,py)/near_w;
+    }
+
+    //Plain meshes have a single level
+    template<class Mesh, class Target_t>
+    const Mesh& select_lod(const Mesh& mesh, const Rasterizer<Target_t>&, const std::array<float,16>&, const std::array<float,16>&) {
+        return mesh;
+    }
+
+    //Coarsest level whose simplification error stays within max_pixel_error pixels at the current projected size of the mesh.
+    //A mesh whose bounding sphere covers less than a pixel (or lies behind the eye) gets the coarsest level outright
+    template<class Vertex, class Target_t>
+    const std::vector<std::array<Vertex,3>>& select_lod(const LodMesh<Vertex>& mesh, const Rasterizer<Target_t>& rasterizer,
+                                                        const std::array<float,16>& view, const std::array<float,16>& world) {
+        const float scale = pixels_per_unit(mesh.center, mesh.radius, world, view, rasterizer);
+        if (2.0f*mesh.radius*scale < 1.0f)
+            return mesh.levels.back();
+        size_t level = 0;
+        while (level+1 < mesh.levels.size() && mesh.errors[level+1]*scale <= mesh.max_pixel_error)
+            ++level;
+        return mesh.levels[level];
+    }
+
+};
+#endif // LOD_H
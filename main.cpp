@@ -1,6 +1,7 @@
 #include"rasterization.h"
 #include"scene.h"
 #include"read-obj.h"
+#include"frame-sink.h"
 using namespace pipeline3D;
 #include<iostream>
 #include<chrono>
@@ -39,8 +40,17 @@ using namespace pipeline3D;
 
         // For loop inserting ADD_OBJECTS_ITERATIONS times the same object (but as different instances) in the scene to be renderized
         // Full overlapping of objects is the worst case scenario: incidency of locking the same cell of the mutex vector (see Rasterizer class) is high
+        // Objects are loaded on background threads and show up in the scene at the next frame boundary
         for (int i=0; i< ADD_OBJECTS_ITERATIONS; i++)
-            scene.add_object(Scene<char>::Object(read_obj("cubeMod.obj"),shader));
+            scene.add_object_async([&shader]{ return Scene<char>::Object(read_obj("cubeMod.obj"),shader); });
+        // Wait for the loads so that the timed loop below renders the full scene
+        scene.wait_for_loads();
+
+        //The scene measures its costs and picks serial/parallel execution, number of workers (up to the rasterizer's) and task granularity by itself
+        scene.set_adaptive(true);
+
+        //Staged pipeline (only used without the adaptive version): geometry worker-threads feed triangle batches to raster worker-threads through a lock-free queue (TAKE OFF COMMENT TO EXPERIMENT)
+        // scene.set_pipeline(2, NUMBER_OF_WORKERS-2);
 
         //Another object partially overlapping to the previous ones (TAKE OFF COMMENT TO EXPERIMENT)
         // scene.add_object(Scene<char>::Object(read_obj("strange.obj"),shader));
@@ -56,23 +66,16 @@ using namespace pipeline3D;
         auto end_time = std::chrono::high_resolution_clock::now();
         double elapsed_time = std::chrono::duration<double>(end_time-start_time).count();
         std::cout << "ELAPSED TIME: " << elapsed_time << '\n';
+        std::cout << "SCHEDULE: " << to_string(scene.schedule().strategy) << ", " << scene.schedule().workers << " worker-threads, granularity "
+                  << scene.schedule().granularity << '\n';
 
 
-        // print out the screen with a frame around it
-        std::cout << "\n\n";
-        std::cout << '+';
-        for (int j=0; j!=w; ++j) std::cout << '-';
-        std::cout << "+\n";
-
-        for (int i=0;i!=h;++i) {
-            std::cout << '|';
-            for (int j=0; j!=w; ++j) std::cout << screen[i*w+j];
-            std::cout << "|\n";
-        }
-
-        std::cout << '+';
-        for (int j=0; j!=w; ++j) std::cout << '-';
-        std::cout << "+\n";
+        // print out the screen with a frame around it: the frame sink writes it to stdout with a few vectored writes
+        // (a FrameSink<char> on a file or FIFO submitted inside the render loop captures every frame the same way)
+        std::cout << "\n\n" << std::flush;
+        FrameSink<char> sink("-", FrameFormat::ASCII);
+        sink.submit(rasterizer);
+        sink.flush();
 
         
         return 0;
@@ -5,12 +5,45 @@
 #include<vector>
 #include<array>
 #include<type_traits>
-#include <deque>
+#include<cstdint>
+#include<cstring>
 #include "sync.h"
 
 namespace pipeline3D {
 	
+	//Maximum number of fragments handed at once to a span shader
+	constexpr int SPAN_WIDTH = 16;
 
+	//Run of consecutive fragments of a scanline in SoA form, passed to shaders that provide shade_span(const FragmentSpan<Vertex>&, Target_t* out)
+	//Vertex is seen as a packed sequence of float attributes: attr[k][i] is attribute k (in declaration order) of fragment i.
+	//Fragment i lies at pixel (x+i, y); only the fragments whose bit is set in mask passed the depth test, the others hold garbage.
+	//The shader writes out[i] for i < count, outputs of uncovered fragments are discarded
+	template<class Vertex>
+	struct FragmentSpan {
+		static_assert(std::is_trivially_copyable<Vertex>::value && sizeof(Vertex)%sizeof(float)==0,
+		              "span shading requires a vertex made only of float attributes");
+		static constexpr int attributes = sizeof(Vertex)/sizeof(float);
+
+		int y;
+		int x;
+		int count;
+		std::uint32_t mask;
+		alignas(64) float attr[attributes][SPAN_WIDTH];
+	};
+
+	//Compile-time detection of the span shading interface: shaders without shade_span are called once per pixel.
+	//Plain expression SFINAE, so the headers keep building as C++14
+	template<class Shader, class Vertex, class Target_t>
+	struct has_span_shader {
+	private:
+		template<class S>
+		static auto check(int) -> decltype(std::declval<S&>().shade_span(std::declval<const FragmentSpan<Vertex>&>(), std::declval<Target_t*>()), std::true_type());
+		template<class S>
+		static std::false_type check(...);
+	public:
+		using type = decltype(check<Shader>(0));
+		static constexpr bool value = type::value;
+	};
 	
 	template<class Target_t>
 	class Rasterizer {
@@ -25,10 +58,12 @@ namespace pipeline3D {
         	width=w;
         	height=h;
         	target=t;
-        	z_buffer.clear();
-            z_buffer.resize(w*h, 1.0f);
-			//Setting the std::deque of mutex according to the size of z buffer
-			zbuffer_mutex.resize(w*h);
+			//z buffer and mutex array are first-touched band by band by threads pinned like the workers (see WorkerHandler::forEachBand),
+			//so with an affinity policy their pages are interleaved over the NUMA nodes the workers run on instead of all sitting on the
+			//main thread's one. The target belongs to the caller: allocate it uninitialized and place it the same way with first_touch_target
+			//before calling set_target
+			z_buffer.assign(w*h, worker_handler, 1.0f);
+			zbuffer_mutex.assign(w*h, worker_handler);
     	}
 		//Wrapper to get max workers from the WorkerHandler instance
 		inline unsigned int getMaxWorkers () {
@@ -38,8 +73,20 @@ namespace pipeline3D {
 		inline void forceMaxWorkers (unsigned int max){
 			worker_handler.forceMaxWorkers(max);
 		}
+		//Wrapper to first-touch a caller-owned target (not yet written) with the same placement as the z buffer
+		inline void first_touch_target(Target_t* t, size_t n, const Target_t& value = Target_t()){
+			first_touch(t, n, worker_handler, value);
+		}
+		//Wrapper to set the worker placement policy; call it before set_target so the buffers are placed accordingly
+		inline void setAffinityPolicy (AffinityPolicy policy){
+			worker_handler.setAffinityPolicy(policy);
+		}
 	
-    	std::vector<Target_t> get_z_buffer() { return std::move(z_buffer); }
+    	std::vector<float> get_z_buffer() { return std::vector<float>(z_buffer.begin(), z_buffer.end()); }
+		//Current target and its size, e.g. to hand the completed frame to a FrameSink
+		inline const Target_t* get_target() const { return target; }
+		inline int get_width() const { return width; }
+		inline int get_height() const { return height; }
 	
     	void set_perspective_projection(float left, float right, float top, float bottom, float near, float far) {
         	const float w=right-left;
@@ -350,6 +397,27 @@ namespace pipeline3D {
         template<class Vertex, class Shader, class Interpolator, class PerspCorrector>
         void render_scanline( int y, int xl, int xr, const Vertex& vl, const Vertex& vr, float ndczl, float ndczr, float w, float step,
                              Shader & shader, Interpolator & interpolate, PerspCorrector & perspective_correct) {
+        	//Tag dispatch: only the path matching the shader interface is instantiated
+        	render_scanline(typename has_span_shader<Shader, Vertex, Target_t>::type(),
+        	                y, xl, xr, vl, vr, ndczl, ndczr, w, step, shader, interpolate, perspective_correct);
+    	}
+
+        template<class Vertex, class Shader, class Interpolator, class PerspCorrector>
+        void render_scanline( std::true_type, int y, int xl, int xr, const Vertex& vl, const Vertex& vr, float ndczl, float ndczr, float w, float step,
+                             Shader & shader, Interpolator & interpolate, PerspCorrector & perspective_correct) {
+        	render_scanline_span(y, xl, xr, vl, vr, ndczl, ndczr, w, step, shader, interpolate, perspective_correct);
+    	}
+
+        template<class Vertex, class Shader, class Interpolator, class PerspCorrector>
+        void render_scanline( std::false_type, int y, int xl, int xr, const Vertex& vl, const Vertex& vr, float ndczl, float ndczr, float w, float step,
+                             Shader & shader, Interpolator & interpolate, PerspCorrector & perspective_correct) {
+        	render_scanline_pixel(y, xl, xr, vl, vr, ndczl, ndczr, w, step, shader, interpolate, perspective_correct);
+    	}
+
+        //One shader call per pixel
+        template<class Vertex, class Shader, class Interpolator, class PerspCorrector>
+        void render_scanline_pixel( int y, int xl, int xr, const Vertex& vl, const Vertex& vr, float ndczl, float ndczr, float w, float step,
+                             Shader & shader, Interpolator & interpolate, PerspCorrector & perspective_correct) {
         	constexpr float epsilon = 1.0e-8f;
                 if (y<0 || y>=height || xl>xr) return;
 
@@ -357,7 +425,8 @@ namespace pipeline3D {
         	int x=std::max(xl,0);
         	w += (xl-x)*step;
 
-			for (; x!=std::min(width,xr+1); ++x) {
+			//w advances for every pixel, hidden ones included, so the interpolation matches the span path
+			for (; x!=std::min(width,xr+1); ++x, w -= step) {
 				const float ndcz=interpolatef(ndczl,ndczr,w);
 				const unsigned int cell = y*width+x;
 				//Only critical section of the code, 2 or more threads could read and/or write a z_buffer[cell] with a non-synchronized value
@@ -368,20 +437,74 @@ namespace pipeline3D {
             	p=interpolate(vl,vr,w);
             	perspective_correct(p);
                 target[cell] = shader(p);
-            	w -= step;				
         	}
     	}
 
+        //Span version of render_scanline: depth test and interpolation are done per pixel as above, but the covered fragments are gathered
+        //in SoA form and shaded SPAN_WIDTH at a time, so the shader loop can be vectorized.
+        //Shading happens outside the cell locks, so a fragment is written only if its depth is still the one in the z buffer
+        //(a closer fragment from another thread may have won the cell in the meantime)
+        template<class Vertex, class Shader, class Interpolator, class PerspCorrector>
+        void render_scanline_span( int y, int xl, int xr, const Vertex& vl, const Vertex& vr, float ndczl, float ndczr, float w, float step,
+                             Shader & shader, Interpolator & interpolate, PerspCorrector & perspective_correct) {
+        	constexpr float epsilon = 1.0e-8f;
+        	constexpr int attributes = FragmentSpan<Vertex>::attributes;
+                if (y<0 || y>=height || xl>xr) return;
+
+        	FragmentSpan<Vertex> span;
+        	float span_z[SPAN_WIDTH];
+        	Target_t out[SPAN_WIDTH];
+        	float p_attr[attributes];
+        	Vertex p;
+        	int x=std::max(xl,0);
+        	w += (xl-x)*step;
+        	const int end=std::min(width,xr+1);
+        	span.y=y;
+
+        	for (; x<end; x+=SPAN_WIDTH) {
+        		span.x=x;
+        		span.count=std::min(SPAN_WIDTH,end-x);
+        		span.mask=0;
+        		for (int i=0; i!=span.count; ++i, w-=step) {
+        			const float ndcz=interpolatef(ndczl,ndczr,w);
+        			const unsigned int cell = y*width+x+i;
+        			{
+        				std::lock_guard<SpinLockMutex> lock(zbuffer_mutex[cell]);
+        				if ((z_buffer[cell]+epsilon)<ndcz) continue;
+        				z_buffer[cell] = ndcz;
+        			}
+        			p=interpolate(vl,vr,w);
+        			perspective_correct(p);
+        			std::memcpy(p_attr, &p, sizeof(Vertex));
+        			for (int k=0; k!=attributes; ++k)
+        				span.attr[k][i]=p_attr[k];
+        			span_z[i]=ndcz;
+        			span.mask |= std::uint32_t(1)<<i;
+        		}
+        		if (!span.mask) continue;
+
+        		shader.shade_span(static_cast<const FragmentSpan<Vertex>&>(span), out);
+
+        		for (int i=0; i!=span.count; ++i) {
+        			if (!(span.mask & (std::uint32_t(1)<<i))) continue;
+        			const unsigned int cell = y*width+x+i;
+        			std::lock_guard<SpinLockMutex> lock(zbuffer_mutex[cell]);
+        			if (z_buffer[cell]==span_z[i])
+        				target[cell] = out[i];
+        		}
+        	}
+        }
+
 	
     	int width;
     	int height;
 
-		//Deque of mutex with same size as z buffer to lock only the z buffer cell that is used at that moment
-		//Could not use std::vector with mutex, std::deque works and has O(1) access operator [] like std::vector
+		//Array of mutex with same size as z buffer to lock only the z buffer cell that is used at that moment
+		//Could not use std::vector with mutex (not movable), FirstTouchArray constructs them in place and has O(1) access operator [] like std::vector
 		//Mutex used is a custom SpinLock, slightly better than the std::mutex in some scenarios
-	    std::deque<SpinLockMutex> zbuffer_mutex;
+	    FirstTouchArray<SpinLockMutex> zbuffer_mutex;
     	Target_t* target;
-		std::vector<float> z_buffer;
+		FirstTouchArray<float> z_buffer;
 	};
 	
 }//pipeline3D
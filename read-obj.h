@@ -20,6 +20,9 @@ namespace pipeline3D {
     float v;
     };
 
+    //Index of each Vertex field inside FragmentSpan<Vertex>::attr (see rasterization.h)
+    enum VertexAttribute { ATTR_X, ATTR_Y, ATTR_Z, ATTR_NX, ATTR_NY, ATTR_NZ, ATTR_U, ATTR_V };
+
     inline Vertex interpolate(const Vertex& v1, const Vertex& v2, float w) {
             const float w2 = (1.0f-w);
             Vertex v;
@@ -3,7 +3,17 @@
 #pragma once
 #include<memory>
 #include<utility>
+#include<atomic>
+#include<iterator>
+#include<algorithm>
+#include<numeric>
+#include<chrono>
+#include<deque>
+#include<exception>
+#include<unordered_map>
 #include"rasterization.h"
+#include"lod.h"
+#include"scheduler.h"
 
 
 
@@ -12,12 +22,32 @@ namespace pipeline3D {
 
 const std::array<float,16> Identity{1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1};
 
+//Stable handle of an object in a scene, returned by add_object/add_object_async. Unlike the position in the object list,
+//it is known as soon as the object is added, even while it is still loading
+using ObjectId = size_t;
+
+//List of (object id, world matrix) updates committed together by a simulation thread
+using TransformBatch = std::vector<std::pair<ObjectId,std::array<float,16>>>;
+
 
 template<class target_t>
 class Scene {
 public:
 
     Scene(): view_(Identity) {};
+    //The loader thread works on the scene: loads still queued are dropped, the one in progress is completed before tearing it down
+    ~Scene() {
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            stop_loader = true;
+            pending_loads -= load_queue.size();
+            load_queue.clear();
+            pending_cv.notify_all();
+        }
+        if (loader.joinable())
+            loader.join();
+    }
+    //Read by the render workers during a frame: while rendering runs concurrently, write it through set_view instead
     std::array<float,16> view_;
     class Object{
     public:
@@ -34,22 +64,32 @@ public:
         void render(Rasterizer<target_t>& rasterizer, const std::array<float,16>& view) {pimpl->render(rasterizer,view,world_);}
 
         //Render method launched by the multi-threaded version (n° user-defined workers > 1) inside a thread
-        void parallel_render(Rasterizer<target_t>& rasterizer, const std::array<float,16>& view, Scene & scene) {
+        void parallel_render(Rasterizer<target_t>& rasterizer, const std::array<float,16>& view, Scene & scene, unsigned int slot) {
+            //Thread binds itself to the CPU of its worker slot (no-op without an affinity policy)
+            rasterizer.worker_handler.pinWorker(slot);
             pimpl->render(rasterizer,view,world_);
-            //Thread decrements used workers guard by 1 and notifies a waiting worker-thread
-            rasterizer.worker_handler.removeWorker();
+            //Thread decrements used workers guard by 1, frees its slot and notifies a waiting worker-thread
+            rasterizer.worker_handler.removeWorker(slot);
             //Thread increments finished objects counter and notifies the main thread
             std::lock_guard<std::mutex> lock(scene.scene_mutex);
             scene.finished_objects++;
             scene.scene_cv.notify_one();
         }
+        //Read by the render workers during a frame: while rendering runs concurrently, write it through Scene::set_world/commit_transforms
         std::array<float,16> world_;
 
     private:
+        friend class Scene;
 
         struct Object_impl {
           virtual ~Object_impl() {}
           virtual void render(Rasterizer<target_t>& rasterizer, const std::array<float,16>& view, const std::array<float,16>& world)=0;
+          //Staged version of render, used by the pipelined scene: prepare() picks the mesh level for this frame and returns its
+          //number of triangles, transform_range() runs the geometry stage on [first,last), raster_range() the raster stage on the
+          //same (already transformed) triangles. Each object is prepared and transformed by a single geometry worker per frame
+          virtual size_t prepare(Rasterizer<target_t>& rasterizer, const std::array<float,16>& view, const std::array<float,16>& world)=0;
+          virtual void transform_range(const std::array<float,16>& view, const std::array<float,16>& world, size_t first, size_t last)=0;
+          virtual void raster_range(Rasterizer<target_t>& rasterizer, size_t first, size_t last)=0;
         };
 
         template<class Mesh, class Shader, class... Textures>
@@ -59,7 +99,8 @@ public:
                 mesh_(std::forward<Mesh>(mesh)), shader_(std::forward<Shader>(shader)), textures_(std::forward<Textures>(textures)...) {}
 
             void render(Rasterizer<target_t>& rasterizer, const std::array<float,16>& view, const std::array<float,16>& world) override {
-                for(const auto& t : mesh_) {
+                //Meshes with levels of detail (LodMesh) submit only the level matching their projected size in this frame
+                for(const auto& t : select_lod(mesh_, rasterizer, view, world)) {
                     auto v1=t[0];
                     auto v2=t[1];
                     auto v3=t[2];
@@ -73,36 +114,173 @@ public:
                 }
             }
 
+            size_t prepare(Rasterizer<target_t>& rasterizer, const std::array<float,16>& view, const std::array<float,16>& world) override {
+                level_ = &select_lod(mesh_, rasterizer, view, world);
+                const size_t count = std::distance(std::begin(*level_), std::end(*level_));
+                transformed_.resize(count);
+                return count;
+            }
 
+            void transform_range(const std::array<float,16>& view, const std::array<float,16>& world, size_t first, size_t last) override {
+                auto t = std::next(std::begin(*level_), first);
+                for (size_t i = first; i != last; ++i, ++t) {
+                    Triangle& v = transformed_[i];
+                    v = {(*t)[0], (*t)[1], (*t)[2]};
+                    for (auto& vertex : v) {
+                        transform(world,vertex);
+                        transform(view,vertex);
+                    }
+                }
+            }
+
+            void raster_range(Rasterizer<target_t>& rasterizer, size_t first, size_t last) override {
+                for (size_t i = first; i != last; ++i)
+                    rasterizer.render_vertices(transformed_[i][0],transformed_[i][1],transformed_[i][2], shader_);
+            }
 
         private:
+            //Mesh level type selected by select_lod (the mesh itself, or one level of a LodMesh) and its triangle/vertex types
+            using Level = std::decay_t<decltype(select_lod(std::declval<const std::decay_t<Mesh>&>(), std::declval<const Rasterizer<target_t>&>(),
+                                                           std::declval<const std::array<float,16>&>(), std::declval<const std::array<float,16>&>()))>;
+            using Vertex = std::decay_t<decltype((*std::begin(std::declval<const Level&>()))[0])>;
+            using Triangle = std::array<Vertex,3>;
+
             Mesh mesh_;
             Shader shader_;
             std::tuple<Textures...> textures_;
+            //Frame state of the pipelined render: level in use and its triangles after the geometry stage
+            const Level* level_ {nullptr};
+            std::vector<Triangle> transformed_;
         };
 
         std::unique_ptr<Object_impl> pimpl;
     };
 
-    void add_object(Object&& o) {objects.emplace_back(std::forward<Object>(o));}
+    //Synchronous insertion: only safe between frames, from the same thread that calls render()
+    ObjectId add_object(Object&& o) {
+        const ObjectId id = next_id.fetch_add(1);
+        place_object(id, std::forward<Object>(o));
+        return id;
+    }
+
+    //Asynchronous insertion: the loader (e.g. a lambda wrapping read_obj) must return an Object. Loads are queued and run one after the
+    //other on a single loader thread owned by the scene, so streaming many assets does not start one thread each.
+    //The finished object is parked in the pending list and handed to the renderer at the next frame boundary (see publish_pending_objects),
+    //so neither the loading nor the insertion can stall or race with a frame being rendered.
+    //An exception thrown by the loader is caught on the loader thread and rethrown to the caller by wait_for_loads.
+    //The returned id is reserved right away, so transforms can be staged for the object before it has finished loading.
+    //The loader is moved into the queue, so it may own move-only resources (e.g. a preloaded mesh or a unique_ptr)
+    template<class Loader>
+    ObjectId add_object_async(Loader&& loader_function) {
+        std::unique_ptr<LoadTask> task = std::make_unique<concrete_LoadTask<std::decay_t<Loader>>>(std::forward<Loader>(loader_function));
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        const ObjectId id = next_id.fetch_add(1);
+        load_queue.emplace_back(id, std::move(task));
+        pending_loads++;
+        if (!loader.joinable())
+            loader = std::thread(&Scene::load_loop, this);
+        pending_cv.notify_all();
+        return id;
+    }
+
+    //Blocks until every asynchronous load has completed, then publishes the loaded objects.
+    //If some loads failed, the first of their exceptions is rethrown (the others are discarded)
+    void wait_for_loads() {
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex);
+            pending_cv.wait(lock, [this]{return pending_loads == 0;});
+            if (!load_errors.empty())
+                error = load_errors.front();
+            load_errors.clear();
+        }
+        publish_pending_objects();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    //Staged transform updates: callable from any thread (e.g. a simulation thread) while a frame is rendering.
+    //Everything committed is applied by render() at the next frame boundary, so a frame never sees a half-updated batch.
+    //Only the latest matrix staged for each object is kept; ids never returned by add_object/add_object_async are rejected
+    void set_view(const std::array<float,16>& view) {
+        std::lock_guard<std::mutex> lock(transform_mutex);
+        pending_view = view;
+        has_pending_view = true;
+        has_pending_transforms.store(true, std::memory_order_release);
+    }
+    bool set_world(ObjectId id, const std::array<float,16>& world) {
+        if (id >= next_id.load())
+            return false;
+        std::lock_guard<std::mutex> lock(transform_mutex);
+        pending_transforms[id] = world;
+        has_pending_transforms.store(true, std::memory_order_release);
+        return true;
+    }
+    //Commits a whole batch under a single lock: it is published all together at the next frame boundary (later entries for the
+    //same object win). Returns false if some entries were rejected because of an unknown id
+    bool commit_transforms(TransformBatch&& batch) {
+        const ObjectId allocated = next_id.load();
+        bool all_valid = true;
+        std::lock_guard<std::mutex> lock(transform_mutex);
+        for (const auto& t : batch) {
+            if (t.first < allocated)
+                pending_transforms[t.first] = t.second;
+            else
+                all_valid = false;
+        }
+        has_pending_transforms.store(true, std::memory_order_release);
+        return all_valid;
+    }
 
     Object& operator[] (size_t i) {return objects[1];}
     size_t size() const {return objects.size();}
     auto begin() {return objects.begin();}
     auto end() {return objects.end();}
 
+    //Enables the staged pipeline: geometry workers transform triangles in batches and push them into a bounded lock-free queue,
+    //raster workers pop the batches and fill them, so the two stages overlap and are sized independently.
+    //Both counts are clamped so that geometry+raster fits the rasterizer's maximum workers; geometry_workers = 0 disables the pipeline
+    void set_pipeline(unsigned int geometry_workers, unsigned int raster_workers, unsigned int batch_triangles = 64, size_t queue_batches = 256) {
+        pipeline_geometry = geometry_workers;
+        pipeline_raster = raster_workers;
+        pipeline_batch = std::max(batch_triangles, 1u);
+        if (geometry_workers > 0)
+            triangle_queue = std::make_unique<BoundedQueue<TriangleBatch>>(queue_batches);
+        else
+            triangle_queue.reset();
+    }
+
+    //Enables the adaptive version: the scene measures frame and object costs and picks by itself whether to go parallel, with how many
+    //workers (up to the rasterizer's maximum) and with which task granularity, re-tuning when the scene changes (see AdaptiveScheduler)
+    void set_adaptive(bool enabled) {adaptive = enabled;}
+    //Configuration the adaptive version is currently using (or trying)
+    const ScheduleConfig& schedule() const {return scheduler.current();}
+
     void render(Rasterizer<target_t>& rasterizer) {
+        //Frame boundary: no worker is reading the object list, so loaded objects can be moved into it
+        publish_pending_objects();
+        publish_pending_transforms();
         unsigned int object_number = objects.size();
         
-        /*Version dispatcher: if the number of user-defined workers is greater than 1 (and so is the number of objects),
+        /*Version dispatcher: the adaptive version if enabled, then the staged pipeline if enabled and there are at least two worker slots for it,
+          otherwise if the number of user-defined workers is greater than 1 (and so is the number of objects),
           the multi-threaded version is launched*/
-        if (rasterizer.worker_handler.getMaxWorkers() > 1 && object_number > 1){
+        const unsigned int max_workers = rasterizer.worker_handler.getMaxWorkers();
+        if (adaptive) {
+            adaptive_render(rasterizer, max_workers);
+        }
+        else if (pipeline_geometry > 0 && max_workers > 1 && object_number > 0) {
+            const unsigned int geometry = std::min(pipeline_geometry, max_workers-1);
+            const unsigned int raster = std::max(1u, std::min(pipeline_raster, max_workers-geometry));
+            pipelined_render(rasterizer, geometry, raster, pipeline_batch);
+        }
+        else if (max_workers > 1 && object_number > 1){
             for (auto& o : objects) {
                 
                 //Object level multithreading
                 //If the worker handler of the rasterizer has reached full capacity of workers, addWorker waits for a removeWorker (above) to free a worker slot and a new thread can be created
-                rasterizer.worker_handler.addWorker();
-                std::thread t_object (&Object::parallel_render, &o, std::ref(rasterizer), std::ref(view_), std::ref(*this)); 
+                const unsigned int slot = rasterizer.worker_handler.addWorker();
+                std::thread t_object (&Object::parallel_render, &o, std::ref(rasterizer), std::ref(view_), std::ref(*this), slot); 
                 //detach() + custom synchronization with condition variable "finished_objects" is more efficient than looping join() for every thread
                 t_object.detach();
             }
@@ -121,12 +299,302 @@ public:
 
 
 private:
+    //Type-erased queued load: unlike std::function it only needs the loader to be movable
+    struct LoadTask {
+        virtual ~LoadTask() {}
+        virtual Object load()=0;
+    };
+
+    template<class Loader>
+    struct concrete_LoadTask : public LoadTask {
+        concrete_LoadTask(Loader&& loader) : loader_(std::move(loader)) {}
+        concrete_LoadTask(const Loader& loader) : loader_(loader) {}
+        Object load() override {return loader_();}
+        Loader loader_;
+    };
+
+    //Loader thread: runs the queued loads in order. pending_loads is decremented (and waiters notified) whether the load succeeds or throws
+    void load_loop() {
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        for (;;) {
+            pending_cv.wait(lock, [this]{return stop_loader || !load_queue.empty();});
+            if (stop_loader)
+                return;
+            const ObjectId id = load_queue.front().first;
+            std::unique_ptr<LoadTask> task = std::move(load_queue.front().second);
+            load_queue.pop_front();
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                Object o = task->load();
+                lock.lock();
+                pending_objects.emplace_back(id, std::move(o));
+            } catch (...) {
+                error = std::current_exception();
+                if (!lock.owns_lock())
+                    lock.lock();
+                load_errors.push_back(error);
+                failed_ids.push_back(id);
+            }
+            has_pending.store(true, std::memory_order_release);
+            pending_loads--;
+            pending_cv.notify_all();
+        }
+    }
+
+    //Unit of work between the stages: a run of triangles of one object, already transformed
+    struct TriangleBatch {
+        typename Object::Object_impl* object;
+        size_t first;
+        size_t last;
+    };
+
+    //Renders one frame with the configuration chosen by the scheduler and reports back how long it took
+    void adaptive_render(Rasterizer<target_t>& rasterizer, unsigned int max_workers) {
+        const ScheduleConfig& config = scheduler.next(max_workers, objects.size());
+        //Never ask for more worker slots than there are (the pipeline needs all of its stages at once, as in render())
+        const unsigned int workers = std::max(1u, std::min(config.workers, max_workers));
+        measure_objects = scheduler.measuring_objects();
+        const auto start = std::chrono::steady_clock::now();
+        if (config.strategy == Strategy::Pipeline && workers >= 2) {
+            if (!triangle_queue)
+                triangle_queue = std::make_unique<BoundedQueue<TriangleBatch>>(256);
+            if (measure_objects)
+                object_triangles.assign(objects.size(), 0);
+            const unsigned int geometry = std::max(1u, workers/4);
+            pipelined_render(rasterizer, geometry, workers-geometry, config.granularity);
+        }
+        else if (config.strategy == Strategy::Tasks) {
+            task_render(rasterizer, workers, config.granularity);
+        }
+        else {
+            for (size_t i = 0; i != objects.size(); i++)
+                render_object(rasterizer, i);
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+        //The stages mix the triangles of all the objects, so the pipeline cannot time them one by one: the work of the frame
+        //(its duration on every worker) is split among the objects by triangle count
+        if (measure_objects && config.strategy == Strategy::Pipeline && workers >= 2) {
+            const size_t triangles = std::accumulate(object_triangles.begin(), object_triangles.end(), size_t(0));
+            for (size_t i = 0; triangles > 0 && i != objects.size(); i++)
+                scheduler.record_object(i, seconds*workers*object_triangles[i]/triangles);
+        }
+        measure_objects = false;
+        scheduler.record_frame(seconds);
+    }
+
+    //Renders object i, timing it for the scheduler during the frames that measure the object costs
+    void render_object(Rasterizer<target_t>& rasterizer, size_t i) {
+        if (!measure_objects) {
+            objects[i].render(rasterizer, view_);
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        objects[i].render(rasterizer, view_);
+        scheduler.record_object(i, std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count());
+    }
+
+    //Dynamic scheduling over the objects: the worker-threads claim granularity objects at a time until all of them are rendered
+    void task_render(Rasterizer<target_t>& rasterizer, unsigned int workers, unsigned int granularity) {
+        next_object.store(0, std::memory_order_relaxed);
+        stage_batch = granularity;
+        for (unsigned int i = 0; i != workers; i++) {
+            const unsigned int slot = rasterizer.worker_handler.addWorker();
+            std::thread t_task (&Scene::task_stage, this, std::ref(rasterizer), slot);
+            t_task.detach();
+        }
+        wait_stages(workers);
+    }
+
+    void task_stage(Rasterizer<target_t>& rasterizer, unsigned int slot) {
+        rasterizer.worker_handler.pinWorker(slot);
+        for (size_t first = next_object.fetch_add(stage_batch, std::memory_order_relaxed); first < objects.size();
+             first = next_object.fetch_add(stage_batch, std::memory_order_relaxed)) {
+            const size_t last = std::min(objects.size(), first + stage_batch);
+            for (size_t i = first; i != last; i++)
+                render_object(rasterizer, i);
+        }
+        finish_stage(rasterizer, slot);
+    }
+
+    //Runs one frame through the staged pipeline. Every stage thread takes a worker slot (and its CPU pinning); since raster workers
+    //wait for the geometry ones, all of them must fit in the worker slots at once, which render() guarantees by clamping the counts
+    void pipelined_render(Rasterizer<target_t>& rasterizer, unsigned int geometry, unsigned int raster, size_t batch) {
+        next_object.store(0, std::memory_order_relaxed);
+        geometry_done.store(0, std::memory_order_relaxed);
+        stage_batch = std::max<size_t>(batch, 1);
+        for (unsigned int i = 0; i != geometry + raster; i++) {
+            const unsigned int slot = rasterizer.worker_handler.addWorker();
+            std::thread t_stage (i < geometry ? &Scene::geometry_stage : &Scene::raster_stage, this, std::ref(rasterizer), geometry, slot);
+            t_stage.detach();
+        }
+        wait_stages(geometry + raster);
+    }
+
+    //Main thread (scene) waits for the given number of stage/task threads to call finish_stage()
+    void wait_stages(unsigned int count) {
+        std::unique_lock<std::mutex> lock(scene_mutex);
+        scene_cv.wait(lock, [this, count]{return (finished_stages == count);});
+        finished_stages = 0;
+    }
+
+    //Geometry worker: claims whole objects, transforms them a batch at a time and pushes every batch as soon as it is ready.
+    //When the queue is full it yields, which leaves the core to the raster workers draining it
+    void geometry_stage(Rasterizer<target_t>& rasterizer, unsigned int, unsigned int slot) {
+        rasterizer.worker_handler.pinWorker(slot);
+        for (size_t i = next_object.fetch_add(1, std::memory_order_relaxed); i < objects.size(); i = next_object.fetch_add(1, std::memory_order_relaxed)) {
+            Object& o = objects[i];
+            const size_t count = o.pimpl->prepare(rasterizer, view_, o.world_);
+            if (measure_objects)
+                object_triangles[i] = count;
+            for (size_t first = 0; first < count; first += stage_batch) {
+                const size_t last = std::min(count, first + stage_batch);
+                o.pimpl->transform_range(view_, o.world_, first, last);
+                const TriangleBatch batch{o.pimpl.get(), first, last};
+                while (!triangle_queue->try_push(batch))
+                    std::this_thread::yield();
+            }
+        }
+        geometry_done.fetch_add(1, std::memory_order_release);
+        finish_stage(rasterizer, slot);
+    }
+
+    //Raster worker: fills batches until every geometry worker is done and the queue is drained
+    void raster_stage(Rasterizer<target_t>& rasterizer, unsigned int geometry, unsigned int slot) {
+        rasterizer.worker_handler.pinWorker(slot);
+        TriangleBatch batch{nullptr, 0, 0};
+        for (;;) {
+            if (triangle_queue->try_pop(batch)) {
+                batch.object->raster_range(rasterizer, batch.first, batch.last);
+                continue;
+            }
+            //Pushes happen before the geometry_done increment: once every geometry worker is done, draining the queue ends the frame
+            if (geometry_done.load(std::memory_order_acquire) == geometry) {
+                while (triangle_queue->try_pop(batch))
+                    batch.object->raster_range(rasterizer, batch.first, batch.last);
+                break;
+            }
+            std::this_thread::yield();
+        }
+        finish_stage(rasterizer, slot);
+    }
+
+    void finish_stage(Rasterizer<target_t>& rasterizer, unsigned int slot) {
+        rasterizer.worker_handler.removeWorker(slot);
+        std::lock_guard<std::mutex> lock(scene_mutex);
+        finished_stages++;
+        scene_cv.notify_one();
+    }
+
+    //Moves the objects loaded in the background into the rendered list. The pending mutex is held only for a swap,
+    //and the atomic flag lets frames without new objects skip the lock entirely
+    void publish_pending_objects() {
+        if (!has_pending.load(std::memory_order_acquire))
+            return;
+        std::vector<std::pair<ObjectId,Object>> ready;
+        std::vector<ObjectId> failed;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            ready.swap(pending_objects);
+            failed.swap(failed_ids);
+            has_pending.store(false, std::memory_order_relaxed);
+        }
+        for (auto& o : ready)
+            place_object(o.first, std::move(o.second));
+        for (ObjectId id : failed) {
+            grow_object_index(id);
+            object_index[id] = FAILED_OBJECT;
+        }
+    }
+
+    //Position in the object list of every id published so far; LOADING_OBJECT while it is still loading (or not seen yet by the renderer)
+    //(enumerators, not static members: resize() binds them to a reference, which would need an out-of-class definition before C++17)
+    enum : size_t { LOADING_OBJECT = static_cast<size_t>(-1), FAILED_OBJECT = static_cast<size_t>(-2) };
+    void grow_object_index(ObjectId id) {
+        if (id >= object_index.size())
+            object_index.resize(id+1, LOADING_OBJECT);
+    }
+    void place_object(ObjectId id, Object&& o) {
+        grow_object_index(id);
+        object_index[id] = objects.size();
+        objects.emplace_back(std::move(o));
+    }
+
+    //Applies the staged transforms. The updates are swapped out under the lock and written to the objects without it, so the
+    //simulation can keep committing the next frame's updates meanwhile. Updates for objects still loading are kept (one per object)
+    //for a later frame, updates for objects whose load failed are dropped
+    void publish_pending_transforms() {
+        if (!has_pending_transforms.load(std::memory_order_acquire))
+            return;
+        std::unordered_map<ObjectId,std::array<float,16>> updates;
+        {
+            std::lock_guard<std::mutex> lock(transform_mutex);
+            updates.swap(pending_transforms);
+            if (has_pending_view) {
+                view_ = pending_view;
+                has_pending_view = false;
+            }
+            has_pending_transforms.store(false, std::memory_order_relaxed);
+        }
+        std::vector<std::pair<ObjectId,std::array<float,16>>> deferred;
+        for (auto& t : updates) {
+            const size_t index = t.first < object_index.size() ? object_index[t.first] : LOADING_OBJECT;
+            if (index == LOADING_OBJECT)
+                deferred.push_back(t);
+            else if (index != FAILED_OBJECT)
+                objects[index].world_ = t.second;
+        }
+        if (!deferred.empty()) {
+            std::lock_guard<std::mutex> lock(transform_mutex);
+            //A newer update staged meanwhile for the same object takes precedence
+            for (auto& t : deferred)
+                pending_transforms.emplace(t.first, t.second);
+            has_pending_transforms.store(true, std::memory_order_relaxed);
+        }
+    }
+
     friend class Object;
     //Tools to enable synchronization without using join()
     std::mutex scene_mutex;
     std::condition_variable scene_cv;
     unsigned int finished_objects{0} ;
+    unsigned int finished_stages{0};
+    //Staged pipeline configuration and shared state
+    unsigned int pipeline_geometry{0};
+    unsigned int pipeline_raster{0};
+    size_t pipeline_batch{64};
+    std::unique_ptr<BoundedQueue<TriangleBatch>> triangle_queue;
+    std::atomic<size_t> next_object{0};
+    std::atomic<unsigned int> geometry_done{0};
+    //Objects per task or triangles per batch of the frame being rendered
+    size_t stage_batch{64};
+    //Adaptive version
+    bool adaptive{false};
+    AdaptiveScheduler scheduler;
+    //Set for the frames that report the cost of every object to the scheduler; triangles of every object in pipeline frames
+    bool measure_objects{false};
+    std::vector<size_t> object_triangles;
     std::vector<Object> objects;
+    //Handoff between background loaders and the renderer
+    std::mutex pending_mutex;
+    std::condition_variable pending_cv;
+    unsigned int pending_loads{0};
+    std::atomic<bool> has_pending{false};
+    std::vector<std::pair<ObjectId,Object>> pending_objects;
+    std::vector<ObjectId> failed_ids;
+    std::deque<std::pair<ObjectId,std::unique_ptr<LoadTask>>> load_queue;
+    std::vector<std::exception_ptr> load_errors;
+    bool stop_loader{false};
+    std::thread loader;
+    //Handoff between the simulation and the renderer
+    std::mutex transform_mutex;
+    std::atomic<bool> has_pending_transforms{false};
+    bool has_pending_view{false};
+    std::array<float,16> pending_view;
+    std::unordered_map<ObjectId,std::array<float,16>> pending_transforms;
+    //Id allocation and id -> object list position
+    std::atomic<ObjectId> next_id{0};
+    std::vector<size_t> object_index;
 
 };
 
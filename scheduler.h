@@ -0,0 +1,187 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#pragma once
+#include<vector>
+#include<chrono>
+#include<thread>
+#include<algorithm>
+#include<numeric>
+
+namespace pipeline3D {
+
+    //Execution strategies a Scene can render a frame with
+    enum class Strategy {
+        Serial,     //Every object on the calling thread
+        Tasks,      //workers threads pulling chunks of granularity objects
+        Pipeline    //Staged pipeline with workers threads in total, granularity triangles per batch
+    };
+
+    inline const char* to_string(Strategy strategy) {
+        switch (strategy) {
+        case Strategy::Serial: return "serial";
+        case Strategy::Tasks: return "tasks";
+        case Strategy::Pipeline: return "pipeline";
+        }
+        return "";
+    }
+
+    struct ScheduleConfig {
+        Strategy strategy;
+        unsigned int workers;
+        unsigned int granularity;
+    };
+
+    //Picks the execution strategy of a scene from measured costs.
+    //Exploration: one trial of a few frames per candidate configuration. The first trial also measures the cost of every object,
+    //and only the configurations predicted to beat it are tried next. The very first exploration starts from the serial
+    //configuration; later ones start from the configuration in use, so re-tuning does not stall the scene with serial frames.
+    //Exploitation: the fastest configuration is kept, and exploration restarts when the number of objects or workers changes
+    //(even in the middle of an exploration), when the frame time drifts away from the measured one (e.g. objects switched LOD)
+    //or every retune_frames frames
+    class AdaptiveScheduler {
+    public:
+
+        //Frames per trial (the first of which is a discarded warm-up), frames between periodic re-tunings, tolerated slowdown
+        AdaptiveScheduler(unsigned int trial_frames = 4, unsigned int retune_frames = 1000, double drift = 1.5) :
+            trial_frames(std::max(trial_frames, 2u)), retune_frames(retune_frames), drift(drift) {}
+
+        //Configuration to render the next frame with
+        const ScheduleConfig& next(unsigned int max_workers, size_t objects) {
+            if (objects != tuned_objects || max_workers != tuned_workers ||
+                (!exploring && (frames_since_tune >= retune_frames || average > drift*best_time)))
+                explore(max_workers, objects);
+            return current();
+        }
+
+        //True when the frame about to be rendered should report the cost of every object through record_object.
+        //Objects are distinct, so different threads may report different objects of the same frame
+        bool measuring_objects() const {
+            return exploring && trial == 0 && trial_frame > 0;
+        }
+        void record_object(size_t i, double seconds) {
+            if (i < object_costs.size())
+                object_costs[i] += seconds;
+        }
+
+        //Reports the duration of the frame rendered with the configuration returned by next()
+        void record_frame(double seconds) {
+            if (!exploring) {
+                average = 0.9*average + 0.1*seconds;
+                frames_since_tune++;
+                return;
+            }
+            if (trial_frame++ > 0)
+                trial_time += seconds;
+            if (trial_frame < trial_frames)
+                return;
+            times[trial] = trial_time/(trial_frames-1);
+            if (trial == 0)
+                add_parallel_candidates();
+            trial_frame = 0;
+            trial_time = 0.0;
+            if (++trial == candidates.size()) {
+                const size_t fastest = std::min_element(times.begin(), times.end()) - times.begin();
+                best = candidates[fastest];
+                best_time = times[fastest];
+                average = best_time;
+                frames_since_tune = 0;
+                exploring = false;
+                tuned = true;
+            }
+        }
+
+        //Configuration currently in use (or under trial)
+        const ScheduleConfig& current() const {
+            return exploring ? candidates[trial] : best;
+        }
+
+    private:
+
+        //The first trial runs the serial configuration the first time, then the best one so far, fitted to the current workers
+        void explore(unsigned int max_workers, size_t objects) {
+            tuned_objects = objects;
+            tuned_workers = max_workers;
+            ScheduleConfig first {Strategy::Serial, 1, 1};
+            if (tuned && best.strategy != Strategy::Serial && std::min(best.workers, max_workers) >= 2)
+                first = ScheduleConfig{best.strategy, std::min(best.workers, max_workers), best.granularity};
+            candidates.assign(1, first);
+            times.assign(1, 0.0);
+            object_costs.assign(objects, 0.0);
+            trial = 0;
+            trial_frame = 0;
+            trial_time = 0.0;
+            exploring = true;
+        }
+
+        //Cost of starting and finishing one worker-thread, measured once
+        static double spawn_cost() {
+            static const double cost = []{
+                constexpr int samples = 16;
+                auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i != samples; i++)
+                    std::thread([]{}).join();
+                return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count()/samples;
+            }();
+            return cost;
+        }
+
+        //Builds the candidates from the first trial: with total the serial cost of the measured objects, for k workers the frame is
+        //predicted to take at best max(total/k, most expensive object) plus the cost of starting k threads, and is tried only if that
+        //beats the first trial. The serial configuration is tried again only if total does
+        void add_parallel_candidates() {
+            const size_t objects = object_costs.size();
+            if (objects == 0)
+                return;
+            const double total = std::accumulate(object_costs.begin(), object_costs.end(), 0.0)/(trial_frames-1);
+            const double heaviest = *std::max_element(object_costs.begin(), object_costs.end())/(trial_frames-1);
+            if (total < times[0])
+                add_candidate(ScheduleConfig{Strategy::Serial, 1, 1});
+            for (unsigned int k = 2; k <= tuned_workers; k = std::min(2*k, tuned_workers)) {
+                const double predicted = std::max(total/k, heaviest) + k*spawn_cost();
+                if (predicted < times[0]) {
+                    //Objects per task: one by one, or about four chunks per worker to cut the scheduling overhead
+                    if (objects > 1) {
+                        const unsigned int tasks = std::min<size_t>(k, objects);
+                        add_candidate(ScheduleConfig{Strategy::Tasks, tasks, 1});
+                        add_candidate(ScheduleConfig{Strategy::Tasks, tasks, static_cast<unsigned int>(std::max<size_t>(1, objects/(4*tasks)))});
+                    }
+                    //A single heavy object only parallelizes at triangle level
+                    add_candidate(ScheduleConfig{Strategy::Pipeline, k, 64});
+                }
+                if (k == tuned_workers) break;
+            }
+            times.resize(candidates.size(), 0.0);
+        }
+
+        //Every configuration is tried once per exploration: with fewer objects than workers, different k give the same Tasks config
+        void add_candidate(const ScheduleConfig& config) {
+            for (const auto& c : candidates)
+                if (c.strategy == config.strategy && c.workers == config.workers && c.granularity == config.granularity)
+                    return;
+            candidates.push_back(config);
+        }
+
+        const unsigned int trial_frames;
+        const unsigned int retune_frames;
+        const double drift;
+
+        std::vector<ScheduleConfig> candidates{ScheduleConfig{Strategy::Serial, 1, 1}};
+        std::vector<double> times{0.0};
+        std::vector<double> object_costs;
+        bool exploring {false};
+        size_t trial {0};
+        unsigned int trial_frame {0};
+        double trial_time {0.0};
+        ScheduleConfig best {Strategy::Serial, 1, 1};
+        double best_time {0.0};
+        double average {0.0};
+        unsigned int frames_since_tune {0};
+        //Scene shape the current choice was tuned for; objects = -1 forces the first exploration
+        size_t tuned_objects {static_cast<size_t>(-1)};
+        unsigned int tuned_workers {0};
+        //Set once an exploration has completed: later ones start from best instead of the serial configuration
+        bool tuned {false};
+    };
+
+};
+#endif // SCHEDULER_H
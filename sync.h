@@ -7,6 +7,17 @@
 #include <vector>
 #include <condition_variable>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <new>
+#include <algorithm>
+#include <memory>
+#include <cstddef>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace pipeline3D {
     //Custom Mutex, slightly more efficient when used in the fragment computation
@@ -21,6 +32,85 @@ namespace pipeline3D {
 
     const unsigned int max_hardware = std::thread::hardware_concurrency();
 
+    //Placement of the worker-threads on the cores
+    enum class AffinityPolicy {
+        None,       //The OS places the threads (default)
+        Compact,    //Fills all the cores of a NUMA node before moving to the next one
+        Scatter     //Round robin over the NUMA nodes, spreading workers and framebuffer pages across the sockets
+    };
+
+    //Parses a sysfs cpu list such as "0-3,8-11"
+    inline std::vector<unsigned int> parse_cpu_list(const std::string& list) {
+        std::vector<unsigned int> cpus;
+        std::stringstream tokenizer(list);
+        std::string range;
+        while (std::getline(tokenizer, range, ',')) {
+            if (range.empty() || range[0]=='\n') continue;
+            const size_t dash = range.find('-');
+            const unsigned int first = std::stoul(range.substr(0, dash));
+            const unsigned int last = (dash == std::string::npos) ? first : std::stoul(range.substr(dash+1));
+            for (unsigned int c = first; c <= last; c++)
+                cpus.push_back(c);
+        }
+        return cpus;
+    }
+
+    //True if the process may run on cpu (sched_getaffinity mask, e.g. restricted by a container or taskset)
+    inline bool cpu_allowed(unsigned int cpu) {
+#ifdef __linux__
+        static const cpu_set_t allowed = []{
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) != 0)
+                for (unsigned int c = 0; c < CPU_SETSIZE; c++)
+                    CPU_SET(c, &set);
+            return set;
+        }();
+        return cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed);
+#else
+        (void)cpu;
+        return true;
+#endif
+    }
+
+    //CPUs of every NUMA node the process is allowed to run on, read from sysfs. Without NUMA information a single node holding
+    //all the allowed hardware threads is returned
+    inline std::vector<std::vector<unsigned int>> numa_nodes() {
+        std::vector<std::vector<unsigned int>> nodes;
+        for (unsigned int n = 0; ; n++) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+            if (!in) break;
+            std::string list;
+            std::getline(in, list);
+            std::vector<unsigned int> cpus = parse_cpu_list(list);
+            cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [](unsigned int c){return !cpu_allowed(c);}), cpus.end());
+            if (!cpus.empty())
+                nodes.push_back(std::move(cpus));
+        }
+        if (nodes.empty()) {
+            nodes.emplace_back();
+            for (unsigned int c = 0; nodes.back().size() < std::max(max_hardware, 1u) && c < 4096; c++)
+                if (cpu_allowed(c))
+                    nodes.back().push_back(c);
+            if (nodes.back().empty())
+                nodes.back().push_back(0);
+        }
+        return nodes;
+    }
+
+    //Binds the calling thread to a single CPU; no-op where thread affinity is not supported
+    inline bool pin_current_thread(unsigned int cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
     //Class that handles available worker-threads according to the user-defined maximum workers
     class WorkerHandler {
         private:
@@ -29,6 +119,11 @@ namespace pipeline3D {
             unsigned int max_workers {max_hardware};
             std::mutex worker_mutex;
             std::condition_variable worker_cv;
+            //Every running worker owns a slot, the slot decides the CPU the worker is pinned to
+            std::vector<bool> busy_slots;
+            AffinityPolicy policy {AffinityPolicy::None};
+            //CPUs in the order the slots are assigned to them, built from the NUMA topology according to the policy
+            std::vector<unsigned int> cpu_order;
 
         public:
 
@@ -40,7 +135,10 @@ namespace pipeline3D {
                 else 
                     max_workers = max_hardware;
             }
-            WorkerHandler(const WorkerHandler & wr) : max_workers(wr.max_workers) {}
+            WorkerHandler (unsigned int max, AffinityPolicy p) : WorkerHandler(max) {
+                setAffinityPolicy(p);
+            }
+            WorkerHandler(const WorkerHandler & wr) : max_workers(wr.max_workers), policy(wr.policy), cpu_order(wr.cpu_order) {}
 
             inline unsigned int getMaxWorkers () {
                 return max_workers;
@@ -52,18 +150,203 @@ namespace pipeline3D {
                 max_workers = max;
             }
             //Waits for a free worker slot if the used workers counter is equal to the maximum number of workers; when released increments the former atomically (worker mutex)
-            inline void addWorker(){
+            //Returns the slot taken by the new worker, to be handed back to removeWorker()
+            inline unsigned int addWorker(){
                 std::unique_lock<std::mutex> lock(worker_mutex);
                 worker_cv.wait(lock, [this]{return (used_workers < max_workers);});
                 used_workers++;
+                if (busy_slots.size() < max_workers)
+                    busy_slots.resize(max_workers, false);
+                const unsigned int slot = std::find(busy_slots.begin(), busy_slots.end(), false) - busy_slots.begin();
+                busy_slots[slot] = true;
+                return slot;
             }
-            //Locks the worker mutex, decrements the used workers counter and notifies an addWorker() to release it via condition variable
-            inline void removeWorker(){
+            //Locks the worker mutex, decrements the used workers counter, frees the slot and notifies an addWorker() to release it via condition variable
+            inline void removeWorker(unsigned int slot){
                 std::lock_guard<std::mutex> lock(worker_mutex);
                 used_workers--;
+                busy_slots[slot] = false;
                 worker_cv.notify_one();
             }
 
+            //Selects how workers are placed on the cores; must not be called while workers are running
+            inline void setAffinityPolicy (AffinityPolicy p) {
+                policy = p;
+                cpu_order.clear();
+                if (policy == AffinityPolicy::None)
+                    return;
+                const std::vector<std::vector<unsigned int>> nodes = numa_nodes();
+                if (policy == AffinityPolicy::Compact) {
+                    for (const auto& node : nodes)
+                        cpu_order.insert(cpu_order.end(), node.begin(), node.end());
+                } else {
+                    for (size_t i = 0; ; i++) {
+                        bool added = false;
+                        for (const auto& node : nodes) {
+                            if (i < node.size()) {
+                                cpu_order.push_back(node[i]);
+                                added = true;
+                            }
+                        }
+                        if (!added) break;
+                    }
+                }
+            }
+            inline AffinityPolicy getAffinityPolicy () {
+                return policy;
+            }
+            //Pins the calling thread to the CPU of the given slot (slots beyond the number of CPUs wrap around)
+            inline void pinWorker (unsigned int slot) {
+                if (policy != AffinityPolicy::None && !cpu_order.empty())
+                    pin_current_thread(cpu_order[slot % cpu_order.size()]);
+            }
+
+            //Splits [0,n) in one contiguous band per worker slot and runs f(begin,end) for every band on a thread pinned like that slot.
+            //Used to first-touch buffers, so that their pages are allocated on the NUMA nodes the workers run on. Render workers take
+            //whole objects and write anywhere on the target, so this does not give each worker the band it writes: it interleaves the
+            //pages over the nodes in proportion to the workers placed on each of them, instead of putting them all on the caller's node.
+            //Without an affinity policy the placement is up to the OS anyway and f runs once on the calling thread
+            template<class F>
+            void forEachBand (size_t n, F&& f) {
+                const unsigned int bands = std::min<size_t>(max_workers, n);
+                if (policy == AffinityPolicy::None || bands <= 1) {
+                    f(size_t(0), n);
+                    return;
+                }
+                std::vector<std::thread> band_threads;
+                for (unsigned int b = 0; b < bands; b++) {
+                    band_threads.emplace_back([this, &f, b, bands, n]{
+                        pinWorker(b);
+                        f(n*b/bands, n*(b+1)/bands);
+                    });
+                }
+                for (auto& t : band_threads)
+                    t.join();
+            }
+
+    };
+
+    //Bounded multi-producer multi-consumer lock-free queue (D. Vyukov's ring of sequenced cells).
+    //Capacity is rounded up to a power of two; try_push/try_pop never block and fail when the queue is full/empty.
+    //A successful pop sees everything the producer wrote before its push (release/acquire on the cell sequence)
+    template<class T>
+    class BoundedQueue {
+        public:
+
+            explicit BoundedQueue (size_t capacity) {
+                size_t size = 2;
+                while (size < capacity)
+                    size <<= 1;
+                mask = size-1;
+                buffer.reset(new Cell[size]);
+                for (size_t i = 0; i != size; i++)
+                    buffer[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            BoundedQueue (const BoundedQueue&) = delete;
+            BoundedQueue& operator= (const BoundedQueue&) = delete;
+
+            bool try_push (const T& value) {
+                size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+                for (;;) {
+                    Cell& cell = buffer[pos & mask];
+                    const size_t seq = cell.sequence.load(std::memory_order_acquire);
+                    const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+                    if (diff == 0) {
+                        if (enqueue_pos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+                            cell.data = value;
+                            cell.sequence.store(pos+1, std::memory_order_release);
+                            return true;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = enqueue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            bool try_pop (T& value) {
+                size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+                for (;;) {
+                    Cell& cell = buffer[pos & mask];
+                    const size_t seq = cell.sequence.load(std::memory_order_acquire);
+                    const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos+1);
+                    if (diff == 0) {
+                        if (dequeue_pos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+                            value = cell.data;
+                            cell.sequence.store(pos+mask+1, std::memory_order_release);
+                            return true;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = dequeue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+        private:
+
+            struct Cell {
+                std::atomic<size_t> sequence;
+                T data;
+            };
+            std::unique_ptr<Cell[]> buffer;
+            size_t mask;
+            //Producers and consumers update different cache lines
+            alignas(64) std::atomic<size_t> enqueue_pos {0};
+            alignas(64) std::atomic<size_t> dequeue_pos {0};
+    };
+
+    //Writes value over [data, data+n) band by band from threads pinned like the workers (see WorkerHandler::forEachBand).
+    //Only useful on memory that nothing has written yet, e.g. a target allocated with new T[n] (trivial T) before set_target
+    template<class T>
+    void first_touch(T* data, size_t n, WorkerHandler& worker_handler, const T& value = T()) {
+        worker_handler.forEachBand(n, [data, &value](size_t begin, size_t end){
+            std::fill(data+begin, data+end, value);
+        });
+    }
+
+    //Fixed-size array whose elements are constructed band by band through WorkerHandler::forEachBand, so each page is first
+    //touched (and therefore placed) by a thread pinned where the workers run. Elements are never moved, so T need not be movable
+    template<class T>
+    class FirstTouchArray {
+        public:
+
+            FirstTouchArray () = default;
+            FirstTouchArray (const FirstTouchArray&) = delete;
+            FirstTouchArray& operator= (const FirstTouchArray&) = delete;
+            ~FirstTouchArray () { release(); }
+
+            template<class... Args>
+            void assign (size_t n, WorkerHandler& worker_handler, const Args&... args) {
+                release();
+                data_ = static_cast<T*>(::operator new(n*sizeof(T)));
+                worker_handler.forEachBand(n, [this, &args...](size_t begin, size_t end){
+                    for (size_t i = begin; i != end; i++)
+                        new (data_+i) T(args...);
+                });
+                size_ = n;
+            }
+
+            inline T& operator[] (size_t i) { return data_[i]; }
+            inline const T& operator[] (size_t i) const { return data_[i]; }
+            inline size_t size () const { return size_; }
+            inline T* begin () { return data_; }
+            inline T* end () { return data_+size_; }
+
+        private:
+
+            void release () {
+                for (size_t i = 0; i != size_; i++)
+                    data_[i].~T();
+                ::operator delete(data_);
+                data_ = nullptr;
+                size_ = 0;
+            }
+
+            T* data_ {nullptr};
+            size_t size_ {0};
     };
 
 };